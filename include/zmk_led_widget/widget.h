@@ -0,0 +1,9 @@
+#pragma once
+
+#include <stdbool.h>
+
+// stealth mode keeps the LED dark and the widget idle until it is turned off
+// again, the setting is persisted if settings are enabled
+void led_widget_set_stealth(bool enabled);
+void led_widget_toggle_stealth(void);
+bool led_widget_get_stealth(void);
@@ -0,0 +1,39 @@
+#define DT_DRV_COMPAT zmk_behavior_led_widget_stealth
+
+#include <zephyr/device.h>
+#include <drivers/behavior.h>
+
+#include <zmk/behavior.h>
+#include <zmk_led_widget/widget.h>
+
+#include <zephyr/logging/log.h>
+
+LOG_MODULE_DECLARE(zmk, CONFIG_ZMK_LOG_LEVEL);
+
+#if DT_HAS_COMPAT_STATUS_OKAY(DT_DRV_COMPAT)
+
+static int behavior_led_widget_stealth_init(const struct device *dev) { return 0; }
+
+static int on_keymap_binding_pressed(struct zmk_behavior_binding *binding,
+                                     struct zmk_behavior_binding_event event) {
+    led_widget_toggle_stealth();
+    return ZMK_BEHAVIOR_OPAQUE;
+}
+
+static int on_keymap_binding_released(struct zmk_behavior_binding *binding,
+                                      struct zmk_behavior_binding_event event) {
+    return ZMK_BEHAVIOR_OPAQUE;
+}
+
+// global locality so that all parts of a split keyboard go dark together
+static const struct behavior_driver_api behavior_led_widget_stealth_driver_api = {
+    .binding_pressed = on_keymap_binding_pressed,
+    .binding_released = on_keymap_binding_released,
+    .locality = BEHAVIOR_LOCALITY_GLOBAL,
+};
+
+BEHAVIOR_DT_INST_DEFINE(0, behavior_led_widget_stealth_init, NULL, NULL, NULL, POST_KERNEL,
+                        CONFIG_KERNEL_INIT_PRIORITY_DEFAULT,
+                        &behavior_led_widget_stealth_driver_api);
+
+#endif // DT_HAS_COMPAT_STATUS_OKAY(DT_DRV_COMPAT)
@@ -1,12 +1,18 @@
+#include <zephyr/bluetooth/conn.h>
 #include <zephyr/device.h>
 #include <zephyr/devicetree.h>
 #include <zephyr/drivers/led.h>
+#include <zephyr/drivers/retained_mem.h>
+#include <zephyr/drivers/sensor.h>
 #include <zephyr/init.h>
 #include <zephyr/kernel.h>
+#include <zephyr/pm/device.h>
+#include <zephyr/settings/settings.h>
 
 #include <zmk/battery.h>
 #include <zmk/ble.h>
 #include <zmk/endpoints.h>
+#include <zmk/events/activity_state_changed.h>
 #include <zmk/events/battery_state_changed.h>
 #include <zmk/events/ble_active_profile_changed.h>
 #include <zmk/events/split_peripheral_status_changed.h>
@@ -14,6 +20,7 @@
 #include <zmk/keymap.h>
 #include <zmk/split/bluetooth/peripheral.h>
 #include <zmk/usb.h>
+#include <zmk_led_widget/widget.h>
 
 #if __has_include(<zmk/split/central.h>)
 #include <zmk/split/central.h>
@@ -31,17 +38,34 @@ BUILD_ASSERT(DT_NODE_EXISTS(DT_NODELABEL(led_widget_led)),
 static const struct device *led_dev = DEVICE_DT_GET(DT_PARENT(DT_NODELABEL(led_widget_led)));
 static const uint32_t led_idx = DT_NODE_CHILD_IDX(DT_NODELABEL(led_widget_led));
 
+#if IS_ENABLED(CONFIG_LED_WIDGET_RETAINED_STATUS)
+BUILD_ASSERT(DT_NODE_EXISTS(DT_NODELABEL(led_widget_retained)),
+             "No node labelled led_widget_retained for LED_WIDGET_RETAINED_STATUS");
+
+static const struct device *retained_dev = DEVICE_DT_GET(DT_NODELABEL(led_widget_retained));
+#endif
+
+#if IS_ENABLED(CONFIG_LED_WIDGET_AMBIENT_LIGHT)
+BUILD_ASSERT(DT_NODE_EXISTS(DT_NODELABEL(led_widget_light_sensor)),
+             "No node labelled led_widget_light_sensor for LED_WIDGET_AMBIENT_LIGHT");
+
+static const struct device *light_dev = DEVICE_DT_GET(DT_NODELABEL(led_widget_light_sensor));
+#endif
+
 // log shorthands
 #define LOG_CONN_CENTRAL(index, status)                                               \
     LOG_INF("Profile %d %s", index, status)
 #define LOG_CONN_PERIPHERAL(status)                                                   \
     LOG_INF("Peripheral %s", status)
+#define LOG_CONN_PERIPHERAL_SLOT(index, status)                                       \
+    LOG_INF("Peripheral %d %s", index, status)
 #define LOG_BATTERY(battery_level)                                                    \
     LOG_INF("Battery level %d", battery_level)
 
 enum message_type {
-    MESSAGE_COLOR_SET,
-    MESSAGE_PATTERN_SWAP,
+    MESSAGE_POLICY_UPDATE,
+    MESSAGE_ACTIVITY,
+    MESSAGE_STEALTH,
 };
 
 enum color {
@@ -53,6 +77,16 @@ struct pattern {
     uint8_t times;
     uint16_t duration_ms;
     uint16_t sleep_ms;
+    // repeat with exponentially growing intervals while the pattern stays active
+    bool backoff;
+    // how much later than requested the pattern may end, to align it to the timer grid
+    uint16_t slack_ms;
+    // only show once when activated instead of repeating while active
+    bool once;
+    // follow a single blink of lead_ms with the code of the active profile, if
+    // enabled
+    bool profile_code;
+    uint16_t lead_ms;
 };
 
 enum pattern_type {
@@ -61,6 +95,9 @@ enum pattern_type {
     PATTERN_BATT_30,
     PATTERN_BATT_20,
     PATTERN_BATT_10,
+    PATTERN_PERIPHERAL_3_MISSING,
+    PATTERN_PERIPHERAL_2_MISSING,
+    PATTERN_PERIPHERAL_1_MISSING,
     PATTERN_ADVERTISING,
     PATTERN_CONNECTED,
     // highest pri
@@ -73,94 +110,535 @@ static const struct pattern PATTERNS[] = {
         .times = 3,
         .duration_ms = CONFIG_LED_WIDGET_BATTERY_BLINK_MS,
         .sleep_ms = CONFIG_LED_WIDGET_BATTERY_BLINK_SLEEP_MS,
+        .slack_ms = CONFIG_LED_WIDGET_TIMER_SLACK_MS,
     },
     // PATTERN_BATT_20
     {
         .times = 2,
         .duration_ms = CONFIG_LED_WIDGET_BATTERY_BLINK_MS,
         .sleep_ms = CONFIG_LED_WIDGET_BATTERY_BLINK_SLEEP_MS,
+        .slack_ms = CONFIG_LED_WIDGET_TIMER_SLACK_MS,
     },
     // PATTERN_BATT_10
     {
         .times = 1,
         .duration_ms = CONFIG_LED_WIDGET_BATTERY_BLINK_MS,
         .sleep_ms = CONFIG_LED_WIDGET_BATTERY_BLINK_SLEEP_MS,
+        .slack_ms = CONFIG_LED_WIDGET_TIMER_SLACK_MS,
+    },
+    // PATTERN_PERIPHERAL_3_MISSING
+    {
+        .times = 3,
+        .duration_ms = CONFIG_LED_WIDGET_CONN_PERIPHERAL_MISSING_MS,
+        .sleep_ms = CONFIG_LED_WIDGET_CONN_PERIPHERAL_MISSING_SLEEP_MS,
+        .backoff = true,
+        .slack_ms = CONFIG_LED_WIDGET_TIMER_SLACK_MS,
+    },
+    // PATTERN_PERIPHERAL_2_MISSING
+    {
+        .times = 2,
+        .duration_ms = CONFIG_LED_WIDGET_CONN_PERIPHERAL_MISSING_MS,
+        .sleep_ms = CONFIG_LED_WIDGET_CONN_PERIPHERAL_MISSING_SLEEP_MS,
+        .backoff = true,
+        .slack_ms = CONFIG_LED_WIDGET_TIMER_SLACK_MS,
+    },
+    // PATTERN_PERIPHERAL_1_MISSING
+    {
+        .times = 1,
+        .duration_ms = CONFIG_LED_WIDGET_CONN_PERIPHERAL_MISSING_MS,
+        .sleep_ms = CONFIG_LED_WIDGET_CONN_PERIPHERAL_MISSING_SLEEP_MS,
+        .backoff = true,
+        .slack_ms = CONFIG_LED_WIDGET_TIMER_SLACK_MS,
     },
     // PATTERN_ADVERTISING
     {
         .times = 1,
         .duration_ms = CONFIG_LED_WIDGET_CONN_ADVERTISING_MS,
         .sleep_ms = 0,
+        .backoff = true,
+        .slack_ms = CONFIG_LED_WIDGET_TIMER_SLACK_MS,
+        .profile_code = true,
+        IF_ENABLED(CONFIG_LED_WIDGET_CONN_SHOW_PROFILE,
+                   (.lead_ms = CONFIG_LED_WIDGET_CONN_PROFILE_ADVERTISING_MS,))
     },
     // PATTERN_CONNECTED
     {
         .times = 1,
         .duration_ms = CONFIG_LED_WIDGET_CONN_CONNECTED_MS,
         .sleep_ms = 0,
+        .once = true,
+        .profile_code = true,
+        IF_ENABLED(CONFIG_LED_WIDGET_CONN_SHOW_PROFILE,
+                   (.lead_ms = CONFIG_LED_WIDGET_CONN_CONNECTED_MS,))
     },
 };
 
+#if IS_ENABLED(CONFIG_LED_WIDGET_CONN_SHOW_PROFILE)
+// Profile codes are the binary profile index as three short (0) or long (1)
+// pulses, most significant first, generated for up to 8 profiles.
+#define PROFILE_CODE_COUNT  8
+#define PROFILE_CODE_PULSES 3
+
+#define PROFILE_CODE_PULSE_MS(index, pulse)                                           \
+    (((index) >> (PROFILE_CODE_PULSES - 1 - (pulse))) & 1                             \
+         ? CONFIG_LED_WIDGET_CONN_PROFILE_LONG_MS                                     \
+         : CONFIG_LED_WIDGET_CONN_PROFILE_SHORT_MS)
+
+#define PROFILE_CODE(index, _)                                                        \
+    {PROFILE_CODE_PULSE_MS(index, 0), PROFILE_CODE_PULSE_MS(index, 1),                \
+     PROFILE_CODE_PULSE_MS(index, 2)}
+
+#define PROFILE_CODE_ON_MS(index)                                                     \
+    (PROFILE_CODE_PULSE_MS(index, 0) + PROFILE_CODE_PULSE_MS(index, 1) +              \
+     PROFILE_CODE_PULSE_MS(index, 2))
+
+static const uint16_t PROFILE_CODES[PROFILE_CODE_COUNT][PROFILE_CODE_PULSES] = {
+    LISTIFY(PROFILE_CODE_COUNT, PROFILE_CODE, (,))
+};
+
+BUILD_ASSERT(ZMK_BLE_PROFILE_COUNT <= PROFILE_CODE_COUNT,
+             "Too many BLE profiles for LED_WIDGET_CONN_SHOW_PROFILE");
+
+#define PROFILE_CODE_FITS(index, _)                                                   \
+    (CONFIG_LED_WIDGET_CONN_PROFILE_ADVERTISING_MS + PROFILE_CODE_ON_MS(index) <       \
+         CONFIG_LED_WIDGET_CONN_ADVERTISING_MS &&                                     \
+     CONFIG_LED_WIDGET_CONN_CONNECTED_MS + PROFILE_CODE_ON_MS(index) <                 \
+         CONFIG_LED_WIDGET_CONN_ADVERTISING_MS)
+
+// the lead blink and profile code together must keep the LED on for less time
+// than the plain advertising blink
+BUILD_ASSERT(LISTIFY(PROFILE_CODE_COUNT, PROFILE_CODE_FITS, (&&)),
+             "Profile codes keep the LED on longer than LED_WIDGET_CONN_ADVERTISING_MS");
+
+// the lead blinks must tell advertising and connected apart, and stand out from
+// the code pulses
+BUILD_ASSERT(CONFIG_LED_WIDGET_CONN_PROFILE_ADVERTISING_MS > CONFIG_LED_WIDGET_CONN_CONNECTED_MS &&
+                 CONFIG_LED_WIDGET_CONN_CONNECTED_MS > CONFIG_LED_WIDGET_CONN_PROFILE_LONG_MS,
+             "Profile code lead blinks are not distinguishable");
+#endif
+
+#if IS_ENABLED(CONFIG_LED_WIDGET_CONN_SHOW_PERIPHERALS)
+#define PERIPHERAL_COUNT CONFIG_ZMK_SPLIT_BLE_CENTRAL_PERIPHERALS
+
+BUILD_ASSERT(PERIPHERAL_COUNT <= 3,
+             "LED_WIDGET_CONN_SHOW_PERIPHERALS supports up to 3 peripherals");
+#else
+#define PERIPHERAL_COUNT 0
+#endif
+
+// The inputs of the widget are packed into a small state index, which is mapped
+// to the set of active patterns (and the background color) through a table
+// generated at build time. Any input change is then a single lookup, followed
+// by applying the difference to the previously applied table entry.
+#define POLICY_USB_MASK       GENMASK(0, 0)
+#define POLICY_TRANSPORT_MASK GENMASK(1, 1)
+#define POLICY_PROFILE_MASK   GENMASK(3, 2)
+#define POLICY_BATTERY_MASK   GENMASK(5, 4)
+// on split peripherals whether the central is connected, otherwise the index of
+// the first missing split peripheral plus one, or zero if none are missing
+#define POLICY_SPLIT_MASK     GENMASK(7, 6)
+// whether the USB host has suspended the bus, which limits the allowed current
+#define POLICY_SUSPEND_MASK   GENMASK(8, 8)
+#define POLICY_STATES         512
+
+#define POLICY_GET(field, state) FIELD_GET(POLICY_##field##_MASK, state)
+#define POLICY_PREP(field, value) FIELD_PREP(POLICY_##field##_MASK, value)
+
+enum policy_profile {
+    POLICY_PROFILE_NONE,
+    POLICY_PROFILE_OPEN,
+    POLICY_PROFILE_CONNECTED,
+};
+
+enum policy_battery {
+    POLICY_BATTERY_OK,
+    POLICY_BATTERY_30,
+    POLICY_BATTERY_20,
+    POLICY_BATTERY_10,
+};
+
+// flags in policy table entries, next to the pattern bits
+#define POLICY_BACKGROUND BIT(14)
+#define POLICY_INVALID    BIT(15)
+
+BUILD_ASSERT(ARRAY_SIZE(PATTERNS) <= 14, "Patterns do not fit into policy table entries");
+
+#define POLICY_ROLE_PERIPHERAL                                                        \
+    (IS_ENABLED(CONFIG_ZMK_SPLIT) && !IS_ENABLED(CONFIG_ZMK_SPLIT_ROLE_CENTRAL))
+
+#define POLICY_VALID(state)                                                           \
+    (POLICY_GET(PROFILE, state) <= POLICY_PROFILE_CONNECTED &&                        \
+     (POLICY_GET(USB, state) || !POLICY_GET(SUSPEND, state)) &&                       \
+     (IS_ENABLED(CONFIG_ZMK_BATTERY_REPORTING) ||                                     \
+      POLICY_GET(BATTERY, state) == POLICY_BATTERY_OK) &&                             \
+     (POLICY_ROLE_PERIPHERAL                                                          \
+          ? POLICY_GET(TRANSPORT, state) == 0 &&                                      \
+                POLICY_GET(PROFILE, state) == POLICY_PROFILE_NONE &&                  \
+                POLICY_GET(SPLIT, state) <= 1                                         \
+          : (IS_ENABLED(CONFIG_ZMK_BLE) ||                                            \
+             POLICY_GET(PROFILE, state) == POLICY_PROFILE_NONE) &&                    \
+                POLICY_GET(SPLIT, state) <= PERIPHERAL_COUNT))
+
+#define POLICY_BATTERY_PATTERNS(state)                                                \
+    (POLICY_GET(BATTERY, state) == POLICY_BATTERY_10   ? BIT(PATTERN_BATT_10)          \
+     : POLICY_GET(BATTERY, state) == POLICY_BATTERY_20 ? BIT(PATTERN_BATT_20)          \
+     : POLICY_GET(BATTERY, state) == POLICY_BATTERY_30 ? BIT(PATTERN_BATT_30)          \
+                                                       : 0)
+
+#define POLICY_CONNECTIVITY_PATTERNS(state)                                           \
+    (POLICY_ROLE_PERIPHERAL                                                           \
+         ? (POLICY_GET(SPLIT, state) ? BIT(PATTERN_CONNECTED) : 0)                    \
+         : (POLICY_GET(PROFILE, state) == POLICY_PROFILE_CONNECTED ? BIT(PATTERN_CONNECTED) \
+            : POLICY_GET(PROFILE, state) == POLICY_PROFILE_OPEN    ? BIT(PATTERN_ADVERTISING) \
+                                                                   : 0) |             \
+               (POLICY_GET(SPLIT, state)                                              \
+                    ? BIT(PATTERN_PERIPHERAL_1_MISSING - (POLICY_GET(SPLIT, state) - 1)) \
+                    : 0))
+
+// the LED stays off while the USB host is suspended
+#define POLICY_ENTRY(state, _)                                                        \
+    (!POLICY_VALID(state)        ? POLICY_INVALID                                     \
+     : POLICY_GET(SUSPEND, state) ? 0                                                 \
+                                  : (POLICY_GET(USB, state) ? POLICY_BACKGROUND : 0) | \
+                                        POLICY_BATTERY_PATTERNS(state) |              \
+                                        POLICY_CONNECTIVITY_PATTERNS(state))
+
+static const uint16_t POLICY_TABLE[POLICY_STATES] = {
+    LISTIFY(POLICY_STATES, POLICY_ENTRY, (,))
+};
+
+#define POLICY_FIELD_MAX(field) FIELD_GET(POLICY_##field##_MASK, POLICY_##field##_MASK)
+
+// the input fields must not overlap and must exactly cover the state index, and
+// every value the widget publishes must fit into its field
+BUILD_ASSERT(POLICY_USB_MASK + POLICY_TRANSPORT_MASK + POLICY_PROFILE_MASK +
+                     POLICY_BATTERY_MASK + POLICY_SPLIT_MASK + POLICY_SUSPEND_MASK ==
+                 POLICY_STATES - 1 &&
+             (POLICY_USB_MASK | POLICY_TRANSPORT_MASK | POLICY_PROFILE_MASK |
+              POLICY_BATTERY_MASK | POLICY_SPLIT_MASK | POLICY_SUSPEND_MASK) ==
+                 POLICY_STATES - 1,
+             "LED widget policy fields overlap or do not cover the state index");
+BUILD_ASSERT(POLICY_PROFILE_CONNECTED <= POLICY_FIELD_MAX(PROFILE) &&
+                 POLICY_BATTERY_10 <= POLICY_FIELD_MAX(BATTERY) &&
+                 PERIPHERAL_COUNT <= POLICY_FIELD_MAX(SPLIT),
+             "LED widget policy values do not fit into their fields");
+BUILD_ASSERT(POLICY_ENTRY(0, _) == 0, "Initial LED widget policy state must be idle");
+
 struct message_item {
     enum message_type type;
-    union {
-        enum color color;
-        struct {
-            enum pattern_type pattern_off;
-            enum pattern_type pattern_on;
-        };
-    };
 };
 
+#if IS_ENABLED(CONFIG_LED_WIDGET_STATS)
+enum stat_type {
+    STAT_LISTENER,
+    STAT_LED_EDGE,
+    STAT_MESSAGES,
+    STAT_PATTERN_SELECTION,
+    STAT_CONNECTIVITY_WORK,
+    STAT_COUNT,
+};
+
+static const char *const STAT_NAMES[] = {"listener", "led edge", "messages",
+                                         "pattern selection", "connectivity work"};
+
+struct cycle_stat {
+    uint32_t count;
+    uint32_t max_cycles;
+    uint64_t total_cycles;
+};
+
+// cycle counts of the widget's hot paths, which can run on different cores
+static struct cycle_stat cycle_stats[STAT_COUNT];
+static struct k_spinlock cycle_stats_lock;
+
+static void stat_record(enum stat_type type, uint32_t start) {
+    uint32_t cycles = k_cycle_get_32() - start;
+    k_spinlock_key_t key = k_spin_lock(&cycle_stats_lock);
+    struct cycle_stat *stat = &cycle_stats[type];
+
+    stat->count++;
+    stat->total_cycles += cycles;
+    stat->max_cycles = MAX(stat->max_cycles, cycles);
+    k_spin_unlock(&cycle_stats_lock, key);
+}
+
+#define STAT_BEGIN() uint32_t stat_start = k_cycle_get_32()
+#define STAT_END(type) stat_record(type, stat_start)
+#else
+#define STAT_BEGIN()
+#define STAT_END(type)
+#endif // IS_ENABLED(CONFIG_LED_WIDGET_STATS)
+
+// index of the active BLE profile, for displaying its profile code
+static atomic_t led_profile_index = ATOMIC_INIT(0);
+
 // flag to indicate whether the initial boot up sequence is complete
-static bool initialized = false;
+static atomic_t initialized = ATOMIC_INIT(false);
 
-// track current color to prevent unnecessary calls (TODO: is this necessary?)
-enum color led_current_color = COLOR_OFF;
+#if IS_ENABLED(CONFIG_LED_WIDGET_STEALTH)
+// requested stealth mode, listeners skip all work while it is set
+static atomic_t stealth = ATOMIC_INIT(false);
+#define STEALTH_ACTIVE() atomic_get(&stealth)
+#else
+#define STEALTH_ACTIVE() false
+#endif
 
-// low-level method to control the LED
-static void set_led(enum color color, uint16_t duration_ms) {
-    if (led_current_color != color) {
-        if (color) {
-            led_on(led_dev, led_idx);
-        } else {
-            led_off(led_dev, led_idx);
-        }
+// default color to use when no patterns are active
+enum color led_default_color = COLOR_OFF;
+
+// track current output brightness to only flush changes to the LED driver
+uint8_t led_current_level = 0;
+
+// blend the foreground state of the active pattern over the background color
+// into a single output brightness in percent, using a Q8 alpha
+static uint8_t composite_level(enum color foreground) {
+    uint16_t background =
+        led_default_color == COLOR_ON ? CONFIG_LED_WIDGET_BACKGROUND_BRIGHTNESS : 0;
+    uint16_t level = CONFIG_LED_WIDGET_FOREGROUND_BRIGHTNESS;
 
-        led_current_color = color;
+    if (foreground == COLOR_OFF) {
+        return background;
     }
-    if (duration_ms > 0) {
-        k_sleep(K_MSEC(duration_ms));
+
+    // a foreground that would not stand out over the background is shown dark
+    if (level <= background) {
+        level = 0;
+    }
+
+    return (level * CONFIG_LED_WIDGET_FOREGROUND_ALPHA +
+            background * (256 - CONFIG_LED_WIDGET_FOREGROUND_ALPHA) + 128) >>
+           8;
+}
+
+#if IS_ENABLED(CONFIG_LED_WIDGET_AMBIENT_LIGHT)
+// brightness scale in Q8 for ambient light levels in lux, interpolated linearly
+// in between and kept constant above the last point
+static const struct {
+    uint16_t lux;
+    uint16_t scale;
+} AMBIENT_CURVE[] = {
+    {0, 26},
+    {10, 64},
+    {100, 128},
+    {1000, 256},
+};
+
+static uint16_t ambient_scale = 256;
+
+// sample the light sensor and update the brightness scale, only done right
+// before a pattern is displayed
+static void ambient_sample(void) {
+    struct sensor_value value;
+
+    if (!device_is_ready(light_dev) ||
+        sensor_sample_fetch_chan(light_dev, SENSOR_CHAN_LIGHT) < 0 ||
+        sensor_channel_get(light_dev, SENSOR_CHAN_LIGHT, &value) < 0) {
+        LOG_WRN("Failed to sample ambient light");
+        return;
+    }
+
+    int32_t lux = MAX(value.val1, 0);
+    ambient_scale = AMBIENT_CURVE[ARRAY_SIZE(AMBIENT_CURVE) - 1].scale;
+    for (uint8_t i = 1; i < ARRAY_SIZE(AMBIENT_CURVE); i++) {
+        if (lux < AMBIENT_CURVE[i].lux) {
+            int32_t lux_lo = AMBIENT_CURVE[i - 1].lux, lux_hi = AMBIENT_CURVE[i].lux;
+            int32_t scale_lo = AMBIENT_CURVE[i - 1].scale, scale_hi = AMBIENT_CURVE[i].scale;
+
+            ambient_scale = scale_lo + (scale_hi - scale_lo) * (lux - lux_lo) / (lux_hi - lux_lo);
+            break;
+        }
+    }
+    LOG_DBG("Ambient light %d lux, brightness scale %d/256", lux, ambient_scale);
+}
+
+// scale an output level with the ambient brightness, keeping a lit LED visible
+static uint8_t ambient_level(uint8_t level) {
+    if (level == 0) {
+        return 0;
     }
+
+    return MAX((level * ambient_scale + 128) >> 8, 1);
 }
+#endif // IS_ENABLED(CONFIG_LED_WIDGET_AMBIENT_LIGHT)
 
 // define message queue of blink work items, that will be processed by a
 // separate thread
 K_MSGQ_DEFINE(led_msgq, sizeof(struct message_item), 16, 1);
 
-bool usb_current_powered = false;
+// separate small queue for urgent updates, which are handled before anything in
+// led_msgq and cut short a pattern that is being displayed
+K_MSGQ_DEFINE(led_prio_msgq, sizeof(struct message_item), 4, 1);
+
+// urgent queue first, used by the processing thread to wait on both queues
+static struct k_poll_event led_msgq_events[] = {
+    K_POLL_EVENT_STATIC_INITIALIZER(K_POLL_TYPE_MSGQ_DATA_AVAILABLE, K_POLL_MODE_NOTIFY_ONLY,
+                                    &led_prio_msgq, 0),
+    K_POLL_EVENT_STATIC_INITIALIZER(K_POLL_TYPE_MSGQ_DATA_AVAILABLE, K_POLL_MODE_NOTIFY_ONLY,
+                                    &led_msgq, 0),
+};
+
+// wait until timeout for data in the first count queues of led_msgq_events
+static bool led_msgq_wait(int count, k_timeout_t timeout) {
+    for (int i = 0; i < count; i++) {
+        led_msgq_events[i].state = K_POLL_STATE_NOT_READY;
+    }
+    return k_poll(led_msgq_events, count, timeout) == 0;
+}
+
+// low-level method to control the LED, compositing the foreground over the
+// background color; returns true if the wait was cut short by an urgent update
+static bool set_led(enum color foreground, uint16_t duration_ms) {
+    uint8_t level = composite_level(foreground);
+
+#if IS_ENABLED(CONFIG_LED_WIDGET_AMBIENT_LIGHT)
+    level = ambient_level(level);
+#endif
+
+    if (led_current_level != level) {
+        STAT_BEGIN();
+        led_set_brightness(led_dev, led_idx, level);
+        led_current_level = level;
+        STAT_END(STAT_LED_EDGE);
+    }
+    if (duration_ms > 0) {
+        return led_msgq_wait(1, K_MSEC(duration_ms));
+    }
+    return false;
+}
+
+// move an uptime deadline to the next point of the timer grid if it is within
+// slack_ms, so that non-urgent wake-ups of the widget coincide with each other;
+// aligned deadlines must be waited for as absolute timeouts, as relative ones
+// are rounded from the current time and end up on different ticks
+static int64_t slack_deadline(int64_t deadline, uint16_t slack_ms) {
+    int64_t grid_ms = CONFIG_LED_WIDGET_TIMER_GRID_MS;
+
+    if (grid_ms > 0) {
+        int64_t aligned = deadline + (grid_ms - deadline % grid_ms) % grid_ms;
+
+        if (aligned - deadline <= slack_ms) {
+            return aligned;
+        }
+    }
+    return deadline;
+}
+
+#if IS_ENABLED(CONFIG_LED_WIDGET_RETAINED_STATUS)
+// last known status, kept in retained memory so that it can be shown right
+// away after waking up from soft off, while fresh data is being collected
+struct status_cache {
+    uint16_t magic;
+    uint16_t policy_state;
+    uint8_t stealth;
+    uint8_t checksum;
+};
+
+#define STATUS_CACHE_MAGIC 0x4c59
+
+static struct status_cache status_cache = {
+    .magic = STATUS_CACHE_MAGIC,
+};
+
+static uint8_t status_cache_checksum(const struct status_cache *cache) {
+    const uint8_t *bytes = (const uint8_t *)cache;
+    uint8_t checksum = 0xa5;
+
+    for (size_t i = 0; i < offsetof(struct status_cache, checksum); i++) {
+        checksum = (checksum << 1 | checksum >> 7) ^ bytes[i];
+    }
+    return checksum;
+}
+
+static void status_cache_save(void) {
+    status_cache.checksum = status_cache_checksum(&status_cache);
+    retained_mem_write(retained_dev, 0, (const uint8_t *)&status_cache, sizeof(status_cache));
+}
+
+#define STATUS_CACHE_SET(field, value)                                                \
+    do {                                                                              \
+        status_cache.field = (value);                                                 \
+        status_cache_save();                                                          \
+    } while (0)
+#else
+#define STATUS_CACHE_SET(field, value)
+#endif // IS_ENABLED(CONFIG_LED_WIDGET_RETAINED_STATUS)
+
+// packed input state, published by the listeners and applied by the processing
+// thread, which owns all LED state
+static atomic_t policy_state = ATOMIC_INIT(0);
+
+// one-shot patterns to show again when the policy is next applied
+static atomic_t policy_rearm = ATOMIC_INIT(0);
+
+// update the input state fields in mask and notify the processing thread; it
+// always applies the latest state, so concurrent updates cannot be reordered
+static void policy_set(uint16_t mask, uint16_t value, uint16_t rearm) {
+    struct message_item msg = {.type = MESSAGE_POLICY_UPDATE};
+    atomic_val_t old_state, state;
+
+    do {
+        old_state = atomic_get(&policy_state);
+        state = (old_state & ~mask) | (value & mask);
+
+        if (POLICY_TABLE[state] & POLICY_INVALID) {
+            LOG_WRN("Invalid policy state 0x%02lx", (unsigned long)state);
+            return;
+        }
+    } while (!atomic_cas(&policy_state, old_state, state));
+
+    if (rearm) {
+        atomic_or(&policy_rearm, rearm);
+    }
+
+    // background changes such as USB power and critical battery are urgent
+    uint16_t changed = POLICY_TABLE[state] ^ POLICY_TABLE[old_state];
+    if (changed & (POLICY_BACKGROUND | BIT(PATTERN_BATT_10))) {
+        if (k_msgq_put(&led_prio_msgq, &msg, K_NO_WAIT) == 0) {
+            return;
+        }
+    }
+
+    if (state != old_state || rearm) {
+        k_msgq_put(&led_msgq, &msg, K_NO_WAIT);
+    }
+}
 
 static void indicate_usb_powered(void) {
-    struct message_item msg = {.type = MESSAGE_COLOR_SET};
     bool powered = zmk_usb_is_powered();
-    if (usb_current_powered != powered) {
-        msg.color = powered ? COLOR_ON : COLOR_OFF;
-        k_msgq_put(&led_msgq, &msg, K_NO_WAIT);
+    bool suspended = IS_ENABLED(CONFIG_LED_WIDGET_USB_SUSPEND_OFF) && powered &&
+                     zmk_usb_get_status() == USB_DC_SUSPEND;
+    atomic_val_t state = atomic_get(&policy_state);
 
+    if (POLICY_GET(USB, state) != powered) {
         if (powered) {
             LOG_INF("USB powered, set led on");
         } else {
             LOG_INF("USB not powered, set led off");
         }
-
-        usb_current_powered = powered;
     }
+    if (POLICY_GET(SUSPEND, state) != suspended) {
+        if (suspended) {
+            LOG_INF("USB suspended, set led off");
+        } else {
+            LOG_INF("USB resumed, restore led");
+        }
+    }
+
+    policy_set(POLICY_USB_MASK | POLICY_SUSPEND_MASK,
+               POLICY_PREP(USB, powered) | POLICY_PREP(SUSPEND, suspended), 0);
 }
 
 static int led_charge_listener_cb(const zmk_event_t *eh) {
-    if (initialized) {
+    if (STEALTH_ACTIVE()) {
+        return 0;
+    }
+
+    STAT_BEGIN();
+    if (atomic_get(&initialized)) {
         indicate_usb_powered();
     }
 
+    STAT_END(STAT_LISTENER);
     return 0;
 }
 
@@ -168,68 +646,86 @@ static int led_charge_listener_cb(const zmk_event_t *eh) {
 ZMK_LISTENER(led_charge_listener, led_charge_listener_cb);
 ZMK_SUBSCRIPTION(led_charge_listener, zmk_usb_conn_state_changed);
 
-enum pattern_type current_connectivity_pattern = PATTERN_UNKNOWN;
+#if IS_ENABLED(CONFIG_LED_WIDGET_CONN_SHOW_PERIPHERALS)
+// connection state of each peripheral as a bitmap, indexed by the peripheral
+// slots persisted by ZMK
+static atomic_t peripheral_connected = ATOMIC_INIT(0);
+
+// only indicate the first missing peripheral, the others will follow once it
+// is back
+static uint8_t missing_peripheral(void) {
+    atomic_val_t connected = atomic_get(&peripheral_connected);
+
+    for (uint8_t i = 0; i < PERIPHERAL_COUNT; i++) {
+        if (!(connected & BIT(i))) {
+            LOG_CONN_PERIPHERAL_SLOT(i, "not connected");
+            return i + 1;
+        }
+    }
+
+    return 0;
+}
+#endif // IS_ENABLED(CONFIG_LED_WIDGET_CONN_SHOW_PERIPHERALS)
 
 static void indicate_connectivity_internal(void) {
-    struct message_item msg = {.type = MESSAGE_PATTERN_SWAP};
-    enum pattern_type next_connectivity_pattern;
+    uint8_t state = 0;
 
 #if !IS_ENABLED(CONFIG_ZMK_SPLIT) || IS_ENABLED(CONFIG_ZMK_SPLIT_ROLE_CENTRAL)
-    switch (zmk_endpoints_selected().transport) {
-    case ZMK_TRANSPORT_USB:
-    default: // ZMK_TRANSPORT_BLE
+    state |= POLICY_PREP(TRANSPORT, zmk_endpoints_selected().transport == ZMK_TRANSPORT_BLE);
 #if IS_ENABLED(CONFIG_ZMK_BLE)
-        uint8_t profile_index = zmk_ble_active_profile_index();
-        if (zmk_ble_active_profile_is_connected()) {
-            LOG_CONN_CENTRAL(profile_index, "connected");
-            next_connectivity_pattern = PATTERN_CONNECTED;
-        } else if (zmk_ble_active_profile_is_open()) {
-            LOG_CONN_CENTRAL(profile_index, "open");
-            next_connectivity_pattern = PATTERN_ADVERTISING;
-        } else {
-            LOG_CONN_CENTRAL(profile_index, "not connected");
-            next_connectivity_pattern = PATTERN_UNKNOWN;
-        }
-#endif
-        break;
+    uint8_t profile_index = zmk_ble_active_profile_index();
+    atomic_set(&led_profile_index, profile_index);
+    if (zmk_ble_active_profile_is_connected()) {
+        LOG_CONN_CENTRAL(profile_index, "connected");
+        state |= POLICY_PREP(PROFILE, POLICY_PROFILE_CONNECTED);
+    } else if (zmk_ble_active_profile_is_open()) {
+        LOG_CONN_CENTRAL(profile_index, "open");
+        state |= POLICY_PREP(PROFILE, POLICY_PROFILE_OPEN);
+    } else {
+        LOG_CONN_CENTRAL(profile_index, "not connected");
     }
+#endif
+#if IS_ENABLED(CONFIG_LED_WIDGET_CONN_SHOW_PERIPHERALS)
+    state |= POLICY_PREP(SPLIT, missing_peripheral());
+#endif
 #elif IS_ENABLED(CONFIG_ZMK_SPLIT_BLE)
     if (zmk_split_bt_peripheral_is_connected()) {
         LOG_CONN_PERIPHERAL("connected");
-        next_connectivity_pattern = PATTERN_CONNECTED;
+        state |= POLICY_PREP(SPLIT, 1);
     } else {
         LOG_CONN_PERIPHERAL("not connected");
-        next_connectivity_pattern = PATTERN_UNKNOWN;
     }
 #endif
 
-    if (current_connectivity_pattern != next_connectivity_pattern ) {
-        msg.pattern_off = current_connectivity_pattern;
-        msg.pattern_on = next_connectivity_pattern;
-        k_msgq_put(&led_msgq, &msg, K_NO_WAIT);
-
-        // only blink the connected pattern once
-        if (next_connectivity_pattern == PATTERN_CONNECTED) {
-            msg.pattern_off = next_connectivity_pattern;
-            msg.pattern_on = PATTERN_UNKNOWN;
-            k_msgq_put(&led_msgq, &msg, K_NO_WAIT);
-            next_connectivity_pattern = PATTERN_UNKNOWN;
-        }
-
-        current_connectivity_pattern = next_connectivity_pattern;
-    }
-
+    // blink the connected pattern again on every connectivity event, and restart
+    // advertising blinks, which might be for another profile now
+    policy_set(POLICY_TRANSPORT_MASK | POLICY_PROFILE_MASK | POLICY_SPLIT_MASK, state,
+               BIT(PATTERN_CONNECTED) | BIT(PATTERN_ADVERTISING));
 }
 
 // debouncing to ignore all but last connectivity event, to prevent repeat blinks
 static struct k_work_delayable indicate_connectivity_work;
-static void indicate_connectivity_cb(struct k_work *work) { indicate_connectivity_internal(); }
-static void indicate_connectivity(void) { k_work_reschedule(&indicate_connectivity_work, K_MSEC(16)); }
+static void indicate_connectivity_cb(struct k_work *work) {
+    STAT_BEGIN();
+    indicate_connectivity_internal();
+    STAT_END(STAT_CONNECTIVITY_WORK);
+}
+static void indicate_connectivity(void) {
+    int64_t deadline = slack_deadline(k_uptime_get() + 16, CONFIG_LED_WIDGET_TIMER_SLACK_MS);
+
+    k_work_reschedule(&indicate_connectivity_work, K_TIMEOUT_ABS_MS(deadline));
+}
 
 static int led_output_listener_cb(const zmk_event_t *eh) {
-    if (initialized) {
+    if (STEALTH_ACTIVE()) {
+        return 0;
+    }
+
+    STAT_BEGIN();
+    if (atomic_get(&initialized)) {
         indicate_connectivity();
     }
+    STAT_END(STAT_LISTENER);
     return 0;
 }
 
@@ -245,12 +741,67 @@ ZMK_SUBSCRIPTION(led_output_listener, zmk_ble_active_profile_changed);
 ZMK_SUBSCRIPTION(led_output_listener, zmk_split_peripheral_status_changed);
 #endif
 
-#if IS_ENABLED(CONFIG_ZMK_BATTERY_REPORTING)
-enum pattern_type current_battery_pattern = PATTERN_UNKNOWN;
+#if IS_ENABLED(CONFIG_LED_WIDGET_CONN_SHOW_PERIPHERALS)
+// find the slot of a peripheral connection in the bond order persisted by ZMK,
+// so that the same slot always refers to the same physical part; the central
+// stores the address of every peripheral before connecting to it, so this only
+// looks up the existing slot
+static int peripheral_slot(struct bt_conn *conn) {
+    int slot = zmk_ble_put_peripheral_addr(bt_conn_get_dst(conn));
+
+    return slot < PERIPHERAL_COUNT ? slot : -ENOENT;
+}
+
+// the central only takes the central role for connections to split peripherals
+static bool is_peripheral_conn(struct bt_conn *conn) {
+    struct bt_conn_info info;
+
+    return bt_conn_get_info(conn, &info) == 0 && info.role == BT_CONN_ROLE_CENTRAL;
+}
 
+static void led_peripheral_connected(struct bt_conn *conn, uint8_t err) {
+    if (err || !is_peripheral_conn(conn)) {
+        return;
+    }
+
+    int slot = peripheral_slot(conn);
+    if (slot < 0) {
+        return;
+    }
+
+    atomic_set_bit(&peripheral_connected, slot);
+    if (atomic_get(&initialized) && !STEALTH_ACTIVE()) {
+        indicate_connectivity();
+    }
+}
+
+static void led_peripheral_disconnected(struct bt_conn *conn, uint8_t reason) {
+    if (!is_peripheral_conn(conn)) {
+        return;
+    }
+
+    int slot = peripheral_slot(conn);
+    if (slot < 0) {
+        return;
+    }
+
+    atomic_clear_bit(&peripheral_connected, slot);
+    if (atomic_get(&initialized) && !STEALTH_ACTIVE()) {
+        indicate_connectivity();
+    }
+}
+
+// track peripheral connections on central, coalesced through the connectivity
+// debouncing
+BT_CONN_CB_DEFINE(led_peripheral_conn_callbacks) = {
+    .connected = led_peripheral_connected,
+    .disconnected = led_peripheral_disconnected,
+};
+#endif // IS_ENABLED(CONFIG_LED_WIDGET_CONN_SHOW_PERIPHERALS)
+
+#if IS_ENABLED(CONFIG_ZMK_BATTERY_REPORTING)
 static void set_battery_level(uint8_t battery_level) {
-    struct message_item msg = {.type = MESSAGE_PATTERN_SWAP};
-    enum pattern_type next_battery_pattern;
+    enum policy_battery battery;
 
     if (battery_level == 0) {
         LOG_INF("Battery level undetermined (zero)");
@@ -259,22 +810,16 @@ static void set_battery_level(uint8_t battery_level) {
 
     LOG_BATTERY(battery_level);
     if (battery_level <= 10) {
-        next_battery_pattern = PATTERN_BATT_10;
+        battery = POLICY_BATTERY_10;
     } else if (battery_level <= 20) {
-        next_battery_pattern = PATTERN_BATT_20;
+        battery = POLICY_BATTERY_20;
     } else if (battery_level <= 30) {
-        next_battery_pattern = PATTERN_BATT_30;
+        battery = POLICY_BATTERY_30;
     } else {
-        next_battery_pattern = PATTERN_UNKNOWN;
+        battery = POLICY_BATTERY_OK;
     }
 
-    if (current_battery_pattern != next_battery_pattern) {
-        msg.pattern_off = current_battery_pattern;
-        msg.pattern_on = next_battery_pattern;
-        k_msgq_put(&led_msgq, &msg, K_NO_WAIT);
-
-        current_battery_pattern = next_battery_pattern;
-    }
+    policy_set(POLICY_BATTERY_MASK, POLICY_PREP(BATTERY, battery), 0);
 }
 
 static void indicate_battery(void) {
@@ -290,11 +835,17 @@ static void indicate_battery(void) {
 }
 
 static int led_battery_listener_cb(const zmk_event_t *eh) {
-    if (initialized) {
+    if (STEALTH_ACTIVE()) {
+        return 0;
+    }
+
+    STAT_BEGIN();
+    if (atomic_get(&initialized)) {
         uint8_t battery_level = as_zmk_battery_state_changed(eh)->state_of_charge;
         set_battery_level(battery_level);
     }
 
+    STAT_END(STAT_LISTENER);
     return 0;
 }
 
@@ -303,27 +854,338 @@ ZMK_LISTENER(led_battery_listener, led_battery_listener_cb);
 ZMK_SUBSCRIPTION(led_battery_listener, zmk_battery_state_changed);
 #endif // IS_ENABLED(CONFIG_ZMK_BATTERY_REPORTING)
 
-// default color to use when no patterns are active
-enum color led_default_color = COLOR_OFF;
+#if IS_ENABLED(CONFIG_LED_WIDGET_STEALTH)
+// read all inputs skipped by the listeners during stealth mode again, the
+// resulting policy updates are applied by the processing thread in one pass
+static void stealth_resync_cb(struct k_work *work) {
+    indicate_usb_powered();
+    indicate_connectivity_internal();
+#if IS_ENABLED(CONFIG_ZMK_BATTERY_REPORTING)
+    set_battery_level(zmk_battery_state_of_charge());
+#endif
+}
+
+static K_WORK_DEFINE(stealth_resync_work, stealth_resync_cb);
+
+#if IS_ENABLED(CONFIG_SETTINGS)
+static void stealth_save_cb(struct k_work *work) {
+    uint8_t enabled = atomic_get(&stealth);
+
+    int err = settings_save_one("led_widget/stealth", &enabled, sizeof(enabled));
+    if (err < 0) {
+        LOG_WRN("Failed to save stealth mode setting (err %d)", err);
+    }
+}
+
+// debounce saves like ZMK does for its own settings, to spare the flash
+static K_WORK_DELAYABLE_DEFINE(stealth_save_work, stealth_save_cb);
+#endif
+
+// notify the processing thread of a stealth mode change, as an urgent update
+static void stealth_changed(bool enabled) {
+    struct message_item msg = {.type = MESSAGE_STEALTH};
+
+    LOG_INF("Stealth mode %s", enabled ? "on" : "off");
+    if (k_msgq_put(&led_prio_msgq, &msg, K_NO_WAIT) != 0) {
+        k_msgq_put(&led_msgq, &msg, K_NO_WAIT);
+    }
+
+    if (!enabled && atomic_get(&initialized)) {
+        k_work_submit(&stealth_resync_work);
+    }
+}
+
+void led_widget_set_stealth(bool enabled) {
+    if (atomic_set(&stealth, enabled) == enabled) {
+        return;
+    }
+
+    stealth_changed(enabled);
+#if IS_ENABLED(CONFIG_SETTINGS)
+    k_work_reschedule(&stealth_save_work, K_MSEC(CONFIG_ZMK_SETTINGS_SAVE_DEBOUNCE));
+#endif
+}
+
+void led_widget_toggle_stealth(void) {
+    stealth_changed(!atomic_xor(&stealth, true));
+#if IS_ENABLED(CONFIG_SETTINGS)
+    k_work_reschedule(&stealth_save_work, K_MSEC(CONFIG_ZMK_SETTINGS_SAVE_DEBOUNCE));
+#endif
+}
+
+bool led_widget_get_stealth(void) { return atomic_get(&stealth); }
+
+#if IS_ENABLED(CONFIG_SETTINGS)
+static int stealth_settings_set(const char *name, size_t len, settings_read_cb read_cb,
+                                void *cb_arg) {
+    uint8_t enabled;
+
+    if (!settings_name_steq(name, "stealth", NULL)) {
+        return -ENOENT;
+    }
+    if (len != sizeof(enabled)) {
+        return -EINVAL;
+    }
+
+    int rc = read_cb(cb_arg, &enabled, sizeof(enabled));
+    if (rc < 0) {
+        return rc;
+    }
+
+    // restore without saving it again
+    if (atomic_set(&stealth, enabled) != enabled) {
+        stealth_changed(enabled);
+    }
+    return 0;
+}
+
+SETTINGS_STATIC_HANDLER_DEFINE(led_widget, "led_widget", NULL, stealth_settings_set, NULL, NULL);
+#endif // IS_ENABLED(CONFIG_SETTINGS)
+#endif // IS_ENABLED(CONFIG_LED_WIDGET_STEALTH)
 
-static void display_pattern(uint8_t pattern_index) {
+#if IS_ENABLED(CONFIG_LED_WIDGET_BACKOFF) || CONFIG_LED_WIDGET_STEADY_TIMEOUT_MS > 0
+static int led_activity_listener_cb(const zmk_event_t *eh) {
+    struct message_item msg = {.type = MESSAGE_ACTIVITY};
+    if (STEALTH_ACTIVE()) {
+        return 0;
+    }
+
+    STAT_BEGIN();
+
+    // wake up the processing thread to reset the blink backoff and steady timeout
+    if (atomic_get(&initialized) &&
+        as_zmk_activity_state_changed(eh)->state == ZMK_ACTIVITY_ACTIVE) {
+        k_msgq_put(&led_msgq, &msg, K_NO_WAIT);
+    }
+
+    STAT_END(STAT_LISTENER);
+    return 0;
+}
+
+// run led_activity_listener_cb on activity state change event
+ZMK_LISTENER(led_activity_listener, led_activity_listener_cb);
+ZMK_SUBSCRIPTION(led_activity_listener, zmk_activity_state_changed);
+#endif
+
+#if IS_ENABLED(CONFIG_LED_WIDGET_BACKOFF)
+// number of consecutive repeats of a pattern with backoff enabled, reset on
+// every received message
+static uint8_t backoff_repeats = 0;
+
+// extra wait after a pattern repeat, doubling with every repeat up to a maximum
+static uint32_t backoff_wait_ms(const struct pattern *p) {
+    if (!p->backoff) {
+        return 0;
+    }
+
+    uint32_t wait_ms = CONFIG_LED_WIDGET_INTERVAL_MS * ((1U << backoff_repeats) - 1);
+    if (backoff_repeats >= 16 || wait_ms >= CONFIG_LED_WIDGET_BACKOFF_MAX_MS) {
+        return CONFIG_LED_WIDGET_BACKOFF_MAX_MS;
+    }
+
+    backoff_repeats++;
+    return wait_ms;
+}
+#endif // IS_ENABLED(CONFIG_LED_WIDGET_BACKOFF)
+
+#if IS_ENABLED(CONFIG_LED_WIDGET_CONN_SHOW_PROFILE)
+// display the lead blink of a pattern followed by the code of the profile,
+// returns true if it was cut short by an urgent update
+static bool display_profile_code(uint16_t lead_ms, uint8_t profile_index) {
+    if (set_led(COLOR_ON, lead_ms) ||
+        set_led(COLOR_OFF, CONFIG_LED_WIDGET_CONN_PROFILE_SLEEP_MS)) {
+        return true;
+    }
+
+    if (profile_index >= PROFILE_CODE_COUNT) {
+        LOG_WRN("No profile code for profile %d", profile_index);
+        return false;
+    }
+
+    for (uint8_t i = 0; i < PROFILE_CODE_PULSES; i++) {
+        if (set_led(COLOR_ON, PROFILE_CODES[profile_index][i])) {
+            return true;
+        }
+        if (i < PROFILE_CODE_PULSES - 1 &&
+            set_led(COLOR_OFF, CONFIG_LED_WIDGET_CONN_PROFILE_SLEEP_MS)) {
+            return true;
+        }
+    }
+    return false;
+}
+#endif // IS_ENABLED(CONFIG_LED_WIDGET_CONN_SHOW_PROFILE)
+
+// display a pattern, returns true if it was cut short by an urgent update
+static bool display_pattern(uint8_t pattern_index) {
     if (pattern_index >= sizeof(PATTERNS) / sizeof(PATTERNS[0])) {
         LOG_WRN("Invalid pattern index %d", pattern_index);
-        return;
+        return false;
     }
 
     const struct pattern *p = &PATTERNS[pattern_index];
+#if IS_ENABLED(CONFIG_LED_WIDGET_AMBIENT_LIGHT)
+    ambient_sample();
+#endif
+#if IS_ENABLED(CONFIG_LED_WIDGET_CONN_SHOW_PROFILE)
+    if (p->profile_code) {
+        if (display_profile_code(p->lead_ms, atomic_get(&led_profile_index))) {
+            return true;
+        }
+        return set_led(COLOR_OFF, 0);
+    }
+#endif
     for (uint8_t i = 0; i < p->times; i++) {
-        set_led(led_default_color == COLOR_ON ? COLOR_OFF : COLOR_ON, p->duration_ms);
-        if (i < p->times - 1) {
-            set_led(led_default_color, p->sleep_ms);
+        if (set_led(COLOR_ON, p->duration_ms)) {
+            return true;
+        }
+        if (i < p->times - 1 && set_led(COLOR_OFF, p->sleep_ms)) {
+            return true;
         }
     }
-    set_led(led_default_color, CONFIG_LED_WIDGET_INTERVAL_MS);
+    // the gap to the next pattern is left to the processing thread, so that it
+    // is only waited for if another pattern follows
+    return set_led(COLOR_OFF, 0);
 }
 
 // track currently enabled patterns as a bitmask
-uint8_t led_current_patterns = 0;
+uint16_t led_current_patterns = 0;
+
+// policy table entry last applied to the patterns and background color
+static uint16_t policy_current = 0;
+
+// look up the latest published input state and apply the difference to the
+// previously applied policy entry, only called from the processing thread
+static void policy_apply(void) {
+    uint16_t state = atomic_get(&policy_state);
+    uint16_t rearm = atomic_clear(&policy_rearm);
+    uint16_t next = POLICY_TABLE[state];
+    uint16_t changed = next ^ policy_current;
+
+    led_default_color = (next & POLICY_BACKGROUND) ? COLOR_ON : COLOR_OFF;
+    led_current_patterns &= ~(changed & policy_current);
+    led_current_patterns |= (changed | rearm) & next & ~POLICY_BACKGROUND;
+
+    policy_current = next;
+    STATUS_CACHE_SET(policy_state, state);
+}
+
+#if CONFIG_LED_WIDGET_STEADY_TIMEOUT_MS > 0
+// uptime after which the steady background color is turned off, until the next
+// state change or activity
+static int64_t steady_off_at;
+
+static void steady_restart(void) {
+    led_default_color = (policy_current & POLICY_BACKGROUND) ? COLOR_ON : COLOR_OFF;
+    steady_off_at = k_uptime_get() + CONFIG_LED_WIDGET_STEADY_TIMEOUT_MS;
+}
+
+static void steady_check(void) {
+    if (led_default_color == COLOR_ON && k_uptime_get() >= steady_off_at) {
+        LOG_INF("Steady indication timed out, set led off");
+        led_default_color = COLOR_OFF;
+    }
+}
+#endif // CONFIG_LED_WIDGET_STEADY_TIMEOUT_MS > 0
+
+#if IS_ENABLED(CONFIG_LED_WIDGET_STEALTH)
+// stealth mode as applied by the processing thread
+static bool led_stealth = false;
+
+// follow the requested stealth mode, turning the LED off and suspending its
+// device, or resuming it and showing the complete current status again
+static void stealth_apply(void) {
+    bool enabled = atomic_get(&stealth);
+    if (enabled == led_stealth) {
+        return;
+    }
+
+    led_stealth = enabled;
+    STATUS_CACHE_SET(stealth, enabled);
+    if (enabled) {
+        led_current_patterns = 0;
+        led_default_color = COLOR_OFF;
+        set_led(COLOR_OFF, 0);
+        // show every active pattern again when leaving stealth mode
+        policy_current = 0;
+    }
+
+    if (IS_ENABLED(CONFIG_PM_DEVICE)) {
+        int err = pm_device_action_run(led_dev, enabled ? PM_DEVICE_ACTION_SUSPEND
+                                                        : PM_DEVICE_ACTION_RESUME);
+        if (err < 0 && err != -ENOTSUP && err != -EALREADY) {
+            LOG_WRN("Failed to %s LED device (err %d)", enabled ? "suspend" : "resume", err);
+        }
+    }
+
+    if (!enabled) {
+        policy_apply();
+    }
+}
+#endif // IS_ENABLED(CONFIG_LED_WIDGET_STEALTH)
+
+// get the next message, urgent ones first, waiting until timeout if none are
+// pending
+static int led_msgq_get(struct message_item *msg, k_timeout_t timeout) {
+    while (true) {
+        if (k_msgq_get(&led_prio_msgq, msg, K_NO_WAIT) == 0 ||
+            k_msgq_get(&led_msgq, msg, K_NO_WAIT) == 0) {
+            return 0;
+        }
+        if (!led_msgq_wait(ARRAY_SIZE(led_msgq_events), timeout)) {
+            return -EAGAIN;
+        }
+    }
+}
+
+static void process_message(const struct message_item *msg) {
+    switch (msg->type) {
+    case MESSAGE_POLICY_UPDATE:
+#if IS_ENABLED(CONFIG_LED_WIDGET_STEALTH)
+        if (led_stealth) {
+            break;
+        }
+#endif
+        policy_apply();
+        LOG_DBG(
+            "Got a policy update item from msgq, default color %d, current patterns 0x%x",
+            led_default_color,
+            led_current_patterns
+        );
+        break;
+    case MESSAGE_ACTIVITY:
+        LOG_DBG("Got an activity item from msgq");
+        break;
+#if IS_ENABLED(CONFIG_LED_WIDGET_STEALTH)
+    case MESSAGE_STEALTH:
+        stealth_apply();
+        LOG_DBG("Got a stealth mode item from msgq, stealth %d", led_stealth);
+        break;
+#endif
+    default:
+        LOG_WRN("Unknown message type %d", msg->type);
+        break;
+    }
+}
+
+// time to wait for the next message, until either the active patterns are due
+// to repeat or the steady background color times out
+static k_timeout_t next_timeout(int64_t repeat_at) {
+    int64_t deadline = led_current_patterns != 0 ? repeat_at : INT64_MAX;
+
+#if CONFIG_LED_WIDGET_STEADY_TIMEOUT_MS > 0
+    if (led_default_color == COLOR_ON) {
+        deadline = MIN(deadline, steady_off_at);
+    }
+#endif
+
+    if (deadline == INT64_MAX) {
+        return K_FOREVER;
+    }
+    if (deadline <= k_uptime_get()) {
+        return K_NO_WAIT;
+    }
+    return K_TIMEOUT_ABS_MS(deadline);
+}
 
 extern void led_process_thread(void *d0, void *d1, void *d2) {
     ARG_UNUSED(d0);
@@ -332,56 +1194,199 @@ extern void led_process_thread(void *d0, void *d1, void *d2) {
 
     k_work_init_delayable(&indicate_connectivity_work, indicate_connectivity_cb);
 
-    set_led(led_default_color, 0);
+#if CONFIG_LED_WIDGET_STEADY_TIMEOUT_MS > 0
+    steady_restart();
+#endif
+    set_led(COLOR_OFF, 0);
 
+    int64_t repeat_at = 0;
+    // end of the gap after the last displayed pattern, no pattern starts before
+    int64_t gap_until = 0;
     while (true) {
-        // wait until a message is received and process it
+        // wait until a message is received, or until the next deadline
         struct message_item msg;
-        k_msgq_get(&led_msgq, &msg, led_current_patterns == 0 ? K_FOREVER : K_NO_WAIT);
-        switch (msg.type) {
-        case MESSAGE_COLOR_SET:
-            LOG_DBG("Got a layer color item from msgq, color %d", msg.color);
-            led_default_color = msg.color;
-            break;
-        case MESSAGE_PATTERN_SWAP:
-            if (msg.pattern_off != PATTERN_UNKNOWN) {
-                led_current_patterns &= ~(1 << msg.pattern_off);
-            }
-            if (msg.pattern_on != PATTERN_UNKNOWN) {
-                led_current_patterns |= (1 << msg.pattern_on);
-            }
-            LOG_DBG(
-                "Got a pattern swap item from msgq, pattern off %d, pattern on %d, current pattern %d",
-                msg.pattern_off,
-                msg.pattern_on,
-                led_current_patterns
-            );
-            break;
-        default:
-            LOG_WRN("Unknown message type %d", msg.type);
-            break;
+        bool timed_out = led_msgq_get(&msg, next_timeout(MAX(repeat_at, gap_until))) != 0;
+
+        if (!timed_out) {
+            // process everything pending at once, the policy is always applied
+            // from the latest state so a stale backlog collapses into one update
+            STAT_BEGIN();
+            do {
+                process_message(&msg);
+            } while (led_msgq_get(&msg, K_NO_WAIT) == 0);
+            STAT_END(STAT_MESSAGES);
         }
 
-        if (led_current_patterns == 0) {
-            set_led(led_default_color, 0);
+        // any update makes the patterns due right away, after the gap
+        if (!timed_out) {
+            repeat_at = k_uptime_get();
+        }
+
+#if IS_ENABLED(CONFIG_LED_WIDGET_BACKOFF)
+        if (!timed_out) {
+            backoff_repeats = 0;
+        }
+#endif
+
+#if CONFIG_LED_WIDGET_STEADY_TIMEOUT_MS > 0
+        if (!timed_out) {
+            steady_restart();
+        } else {
+            steady_check();
+        }
+#endif
+
+        // only update the background if the patterns are not due yet
+        if (led_current_patterns == 0 || k_uptime_get() < MAX(repeat_at, gap_until)) {
+            set_led(COLOR_OFF, 0);
             continue;
         }
 
+        STAT_BEGIN();
         uint8_t highest_priority_pattern;
-        uint8_t v = led_current_patterns >> 1;
+        uint16_t v = led_current_patterns >> 1;
         for (highest_priority_pattern = 0; v; highest_priority_pattern++) {
             v >>= 1;
         }
+        STAT_END(STAT_PATTERN_SELECTION);
+
+        // show an interrupted pattern again once the urgent update is handled
+        if (display_pattern(highest_priority_pattern)) {
+            repeat_at = k_uptime_get();
+            continue;
+        }
+        if (PATTERNS[highest_priority_pattern].once) {
+            led_current_patterns &= ~BIT(highest_priority_pattern);
+        }
+
+        uint16_t slack_ms = PATTERNS[highest_priority_pattern].slack_ms;
+        gap_until = slack_deadline(k_uptime_get() + CONFIG_LED_WIDGET_INTERVAL_MS, slack_ms);
+        repeat_at = gap_until;
+#if IS_ENABLED(CONFIG_LED_WIDGET_BACKOFF)
+        // align the absolute deadline, as the gap already ends on the grid
+        uint32_t wait_ms = backoff_wait_ms(&PATTERNS[highest_priority_pattern]);
+        if (wait_ms > 0) {
+            repeat_at = slack_deadline(gap_until + wait_ms, slack_ms);
+        }
+#endif
+    }
+}
+
+#if IS_ENABLED(CONFIG_LED_WIDGET_RETAINED_STATUS)
+// restore the status cached before the last soft off and queue it for display,
+// so that the fresh checks in led_init_thread only need to emit the differences
+static int status_cache_restore(void) {
+    struct status_cache cached;
 
-        display_pattern(highest_priority_pattern);
+    if (!device_is_ready(retained_dev) ||
+        retained_mem_read(retained_dev, 0, (uint8_t *)&cached, sizeof(cached)) < 0) {
+        LOG_WRN("Retained memory for status cache not available");
+        return 0;
     }
+
+    if (cached.magic != STATUS_CACHE_MAGIC || cached.checksum != status_cache_checksum(&cached) ||
+        cached.policy_state >= POLICY_STATES ||
+        (POLICY_TABLE[cached.policy_state] & POLICY_INVALID)) {
+        LOG_DBG("No valid status cache in retained memory");
+        return 0;
+    }
+
+    // stay dark until settings are loaded, even if stealth mode is not persisted
+    if (cached.stealth) {
+#if IS_ENABLED(CONFIG_LED_WIDGET_STEALTH)
+        if (!atomic_set(&stealth, true)) {
+            stealth_changed(true);
+        }
+#endif
+        LOG_INF("Stealth mode cached in retained memory, not restoring status");
+        return 0;
+    }
+
+    // connections do not survive soft off, so only show them once they are back,
+    // and the USB host state is checked again
+    uint16_t state = cached.policy_state & ~POLICY_SUSPEND_MASK;
+    if (POLICY_GET(PROFILE, state) == POLICY_PROFILE_CONNECTED) {
+        state &= ~POLICY_PROFILE_MASK;
+    }
+    if (POLICY_ROLE_PERIPHERAL) {
+        state &= ~POLICY_SPLIT_MASK;
+    }
+
+    // the processing thread has not started yet, so apply the cached state here
+    // to light up the background color right away
+    policy_set(POLICY_STATES - 1, state, 0);
+    policy_apply();
+    set_led(COLOR_OFF, 0);
+
+    LOG_INF("Restored cached status from retained memory");
+    return 0;
 }
 
+SYS_INIT(status_cache_restore, APPLICATION, CONFIG_APPLICATION_INIT_PRIORITY);
+#endif // IS_ENABLED(CONFIG_LED_WIDGET_RETAINED_STATUS)
+
 // define led_process_thread with stack size 1024, start running it 100 ms after
 // boot
 K_THREAD_DEFINE(led_process_tid, 1024, led_process_thread, NULL, NULL, NULL,
                 K_LOWEST_APPLICATION_THREAD_PRIO, 0, 100);
 
+#if IS_ENABLED(CONFIG_LED_WIDGET_STATS)
+// share of elapsed cycles in hundredths of a percent
+static uint32_t cpu_usage(uint64_t cycles, uint64_t elapsed_cycles) {
+    return elapsed_cycles ? cycles * 10000 / elapsed_cycles : 0;
+}
+
+// cycle counts at the previous report, to compute usage over the last window
+static uint64_t stats_last_elapsed_cycles;
+static uint64_t stats_last_thread_cycles;
+static uint64_t stats_last_total_cycles[STAT_COUNT];
+
+static void log_cpu_usage(const char *name, uint64_t cycles, uint64_t last_cycles,
+                          uint64_t elapsed_cycles) {
+    uint32_t cumulative = cpu_usage(cycles, elapsed_cycles);
+    uint32_t windowed =
+        cpu_usage(cycles - last_cycles, elapsed_cycles - stats_last_elapsed_cycles);
+
+    LOG_INF("Stats %s: cpu %u.%02u%% cumulative, %u.%02u%% last window", name,
+            cumulative / 100, cumulative % 100, windowed / 100, windowed % 100);
+}
+
+static void stats_report_cb(struct k_work *work) {
+    struct cycle_stat snapshot[STAT_COUNT];
+    k_thread_runtime_stats_t thread_stats;
+    k_spinlock_key_t key = k_spin_lock(&cycle_stats_lock);
+
+    memcpy(snapshot, cycle_stats, sizeof(snapshot));
+    k_spin_unlock(&cycle_stats_lock, key);
+
+    uint64_t elapsed_cycles = k_ms_to_cyc_floor64(k_uptime_get());
+
+    for (uint8_t i = 0; i < STAT_COUNT; i++) {
+        uint32_t avg_cycles = snapshot[i].count ? snapshot[i].total_cycles / snapshot[i].count : 0;
+
+        LOG_INF("Stats %s: count %u, avg %u cycles (%u ns), max %u cycles", STAT_NAMES[i],
+                snapshot[i].count, avg_cycles, (uint32_t)k_cyc_to_ns_floor64(avg_cycles),
+                snapshot[i].max_cycles);
+        log_cpu_usage(STAT_NAMES[i], snapshot[i].total_cycles, stats_last_total_cycles[i],
+                      elapsed_cycles);
+        stats_last_total_cycles[i] = snapshot[i].total_cycles;
+    }
+
+    if (k_thread_runtime_stats_get(led_process_tid, &thread_stats) == 0) {
+        log_cpu_usage("process thread", thread_stats.execution_cycles, stats_last_thread_cycles,
+                      elapsed_cycles);
+        stats_last_thread_cycles = thread_stats.execution_cycles;
+    }
+
+    stats_last_elapsed_cycles = elapsed_cycles;
+
+    k_work_schedule(k_work_delayable_from_work(work), K_MSEC(CONFIG_LED_WIDGET_STATS_REPORT_MS));
+}
+
+static K_WORK_DELAYABLE_DEFINE(stats_report_work, stats_report_cb);
+#endif // IS_ENABLED(CONFIG_LED_WIDGET_STATS)
+
+
 extern void led_init_thread(void *d0, void *d1, void *d2) {
     ARG_UNUSED(d0);
     ARG_UNUSED(d1);
@@ -400,7 +1405,11 @@ extern void led_init_thread(void *d0, void *d1, void *d2) {
     indicate_battery();
 #endif // IS_ENABLED(CONFIG_ZMK_BATTERY_REPORTING)
 
-    initialized = true;
+    atomic_set(&initialized, true);
+
+#if IS_ENABLED(CONFIG_LED_WIDGET_STATS)
+    k_work_schedule(&stats_report_work, K_MSEC(CONFIG_LED_WIDGET_STATS_REPORT_MS));
+#endif
     LOG_INF("Finished initializing LED widget");
 }
 
@@ -0,0 +1,60 @@
+#define DT_DRV_COMPAT test_fake_light_sensor
+
+#include <zephyr/device.h>
+#include <zephyr/drivers/sensor.h>
+
+#include "fake_light_sensor.h"
+
+struct fake_light_sensor_data {
+    int32_t lux;
+    int err;
+    uint32_t fetches;
+};
+
+void fake_light_sensor_script(const struct device *dev, int32_t lux, int err) {
+    struct fake_light_sensor_data *data = dev->data;
+
+    data->lux = lux;
+    data->err = err;
+}
+
+uint32_t fake_light_sensor_fetches(const struct device *dev) {
+    struct fake_light_sensor_data *data = dev->data;
+
+    return data->fetches;
+}
+
+static int fake_light_sensor_sample_fetch(const struct device *dev, enum sensor_channel chan) {
+    struct fake_light_sensor_data *data = dev->data;
+
+    data->fetches++;
+    return data->err;
+}
+
+static int fake_light_sensor_channel_get(const struct device *dev, enum sensor_channel chan,
+                                         struct sensor_value *val) {
+    struct fake_light_sensor_data *data = dev->data;
+
+    if (chan != SENSOR_CHAN_LIGHT) {
+        return -ENOTSUP;
+    }
+
+    val->val1 = data->lux;
+    val->val2 = 0;
+    return 0;
+}
+
+static int fake_light_sensor_init(const struct device *dev) { return 0; }
+
+static const struct sensor_driver_api fake_light_sensor_api = {
+    .sample_fetch = fake_light_sensor_sample_fetch,
+    .channel_get = fake_light_sensor_channel_get,
+};
+
+#define FAKE_LIGHT_SENSOR_DEFINE(inst)                                                \
+    static struct fake_light_sensor_data fake_light_sensor_data_##inst;               \
+    SENSOR_DEVICE_DT_INST_DEFINE(inst, fake_light_sensor_init, NULL,                  \
+                                 &fake_light_sensor_data_##inst, NULL, POST_KERNEL,   \
+                                 CONFIG_SENSOR_INIT_PRIORITY, &fake_light_sensor_api);
+
+DT_INST_FOREACH_STATUS_OKAY(FAKE_LIGHT_SENSOR_DEFINE)
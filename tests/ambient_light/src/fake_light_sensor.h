@@ -0,0 +1,10 @@
+#pragma once
+
+#include <zephyr/device.h>
+
+// set the lux value reported from now on, and the error returned when fetching
+// a sample
+void fake_light_sensor_script(const struct device *dev, int32_t lux, int err);
+
+// number of samples fetched so far
+uint32_t fake_light_sensor_fetches(const struct device *dev);
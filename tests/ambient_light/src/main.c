@@ -0,0 +1,74 @@
+#include <zephyr/kernel.h>
+#include <zephyr/ztest.h>
+
+#include "fake_light_sensor.h"
+
+// white-box test of the ambient light curve and where it is sampled
+#include "widget.c"
+
+static void *ambient_light_setup(void) {
+    while (!atomic_get(&initialized)) {
+        k_sleep(K_MSEC(10));
+    }
+    k_sleep(K_MSEC(100));
+    return NULL;
+}
+
+static void ambient_light_before(void *fixture) { fake_light_sensor_script(light_dev, 0, 0); }
+
+ZTEST(ambient_light, test_curve) {
+    // curve points, linear interpolation in between, and clamping outside
+    static const struct {
+        int32_t lux;
+        uint16_t scale;
+    } script[] = {
+        {0, 26},      {5, 45},     {10, 64},    {55, 96},   {100, 128},
+        {550, 192},   {1000, 256}, {5000, 256}, {-3, 26},   {65535, 256},
+    };
+
+    for (size_t i = 0; i < ARRAY_SIZE(script); i++) {
+        fake_light_sensor_script(light_dev, script[i].lux, 0);
+        ambient_sample();
+        zassert_equal(ambient_scale, script[i].scale, "%d lux: scale %d, expected %d",
+                      script[i].lux, ambient_scale, script[i].scale);
+    }
+}
+
+ZTEST(ambient_light, test_failed_sample_keeps_scale) {
+    fake_light_sensor_script(light_dev, 100, 0);
+    ambient_sample();
+    fake_light_sensor_script(light_dev, 1000, -EIO);
+    ambient_sample();
+    zassert_equal(ambient_scale, 128, "Scale changed by a failed sample");
+}
+
+ZTEST(ambient_light, test_level) {
+    fake_light_sensor_script(light_dev, 0, 0);
+    ambient_sample();
+
+    zassert_equal(ambient_level(0), 0, "Dark LED lit up");
+    zassert_equal(ambient_level(100), 10, "Full brightness not scaled");
+    zassert_equal(ambient_level(1), 1, "Dim LED not kept visible");
+}
+
+ZTEST(ambient_light, test_sampled_before_pattern) {
+    struct zmk_battery_state_changed battery = {.state_of_charge = 5};
+    zmk_event_t ev = {.data = &battery};
+    uint32_t fetches = fake_light_sensor_fetches(light_dev);
+
+    // no periodic sampling while idle
+    k_sleep(K_MSEC(2000));
+    zassert_equal(fake_light_sensor_fetches(light_dev), fetches, "Sampled while idle");
+
+    // a critical battery blink samples once and is shown at the scaled level
+    led_battery_listener_cb(&ev);
+    k_sleep(K_MSEC(CONFIG_LED_WIDGET_BATTERY_BLINK_MS / 2));
+    zassert_equal(fake_light_sensor_fetches(light_dev), fetches + 1, "Not sampled once");
+    zassert_equal(led_current_level, ambient_level(CONFIG_LED_WIDGET_FOREGROUND_BRIGHTNESS),
+                  "Blink not shown at the ambient level");
+
+    battery.state_of_charge = 100;
+    led_battery_listener_cb(&ev);
+}
+
+ZTEST_SUITE(ambient_light, NULL, ambient_light_setup, ambient_light_before, NULL, NULL);
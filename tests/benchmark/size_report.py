@@ -0,0 +1,41 @@
+#!/usr/bin/env python3
+"""Print the section sizes of the widget's object file.
+
+Unlike the size of the whole image, these do not depend on the rest of the
+benchmark configuration, so they are comparable between commits when built
+with the same toolchain.
+"""
+
+import sys
+
+from elftools.elf.constants import SH_FLAGS
+from elftools.elf.elffile import ELFFile
+
+GROUPS = (".text", ".rodata", ".data", ".bss", ".noinit")
+
+
+def section_sizes(path):
+    sizes = dict.fromkeys(GROUPS + ("other",), 0)
+
+    with open(path, "rb") as f:
+        for section in ELFFile(f).iter_sections():
+            if not section["sh_flags"] & SH_FLAGS.SHF_ALLOC:
+                continue
+            group = next(
+                (g for g in GROUPS if section.name == g or section.name.startswith(g + ".")),
+                "other",
+            )
+            sizes[group] += section["sh_size"]
+
+    return sizes
+
+
+def main():
+    for path in sys.argv[1:]:
+        if path.endswith("widget.c.obj"):
+            sizes = section_sizes(path)
+            print("LED widget size: " + ", ".join(f"{k} {v}" for k, v in sizes.items()))
+
+
+if __name__ == "__main__":
+    main()
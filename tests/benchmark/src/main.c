@@ -0,0 +1,44 @@
+#include <zephyr/kernel.h>
+#include <zephyr/sys/printk.h>
+
+#include <zmk/event_manager.h>
+#include <zmk/events/battery_state_changed.h>
+#include <zmk/events/usb_conn_state_changed.h>
+#include <zmk_stubs.h>
+
+// scripted workload for the widget, timed so that it runs identically on every
+// run under QEMU icount; the widget's own statistics report the cycle counts
+#define ROUNDS   200
+#define ROUND_MS 50
+
+BUILD_ASSERT(500 + ROUNDS * ROUND_MS < CONFIG_LED_WIDGET_STATS_REPORT_MS,
+             "Workload does not finish before the first statistics report");
+
+extern const struct zmk_listener zmk_listener_led_charge_listener;
+extern const struct zmk_listener zmk_listener_led_battery_listener;
+extern const struct zmk_listener zmk_listener_led_output_listener;
+
+int main(void) {
+    // wait for the widget to finish its initial checks
+    k_sleep(K_MSEC(500));
+
+    for (int i = 0; i < ROUNDS; i++) {
+        // cycle through all battery bands, and USB power on and off
+        struct zmk_battery_state_changed battery = {.state_of_charge = 5 + (i % 4) * 10};
+        struct zmk_usb_conn_state_changed usb = {
+            .conn_state = i % 2 ? ZMK_USB_CONN_POWERED : ZMK_USB_CONN_NONE,
+        };
+        zmk_event_t battery_ev = {.data = &battery}, usb_ev = {.data = &usb};
+
+        stub_usb_powered = usb.conn_state != ZMK_USB_CONN_NONE;
+        zmk_listener_led_battery_listener.callback(&battery_ev);
+        zmk_listener_led_charge_listener.callback(&usb_ev);
+        zmk_listener_led_output_listener.callback(&usb_ev);
+        k_sleep(K_MSEC(ROUND_MS));
+    }
+
+    // wait for the first statistics report after the workload
+    k_sleep(K_TIMEOUT_ABS_MS(CONFIG_LED_WIDGET_STATS_REPORT_MS + 1000));
+    printk("LED widget benchmark done\n");
+    return 0;
+}
@@ -0,0 +1,11 @@
+# Build the widget against the stubbed ZMK headers, included by the test apps
+# after find_package(Zephyr)
+
+set(LED_WIDGET_ROOT ${CMAKE_CURRENT_LIST_DIR}/../..)
+
+target_include_directories(app PRIVATE
+  ${CMAKE_CURRENT_LIST_DIR}/include
+  ${LED_WIDGET_ROOT}/include
+  ${LED_WIDGET_ROOT}/src
+)
+target_sources(app PRIVATE ${CMAKE_CURRENT_LIST_DIR}/src/zmk_stubs.c)
@@ -0,0 +1,7 @@
+#pragma once
+
+enum zmk_activity_state {
+    ZMK_ACTIVITY_ACTIVE,
+    ZMK_ACTIVITY_IDLE,
+    ZMK_ACTIVITY_SLEEP,
+};
@@ -0,0 +1,11 @@
+#pragma once
+
+#include <stdbool.h>
+#include <zephyr/bluetooth/addr.h>
+
+#define ZMK_BLE_PROFILE_COUNT 5
+
+int zmk_ble_active_profile_index(void);
+bool zmk_ble_active_profile_is_connected(void);
+bool zmk_ble_active_profile_is_open(void);
+int zmk_ble_put_peripheral_addr(const bt_addr_le_t *addr);
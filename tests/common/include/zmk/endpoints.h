@@ -0,0 +1,12 @@
+#pragma once
+
+enum zmk_transport {
+    ZMK_TRANSPORT_USB,
+    ZMK_TRANSPORT_BLE,
+};
+
+struct zmk_endpoint_instance {
+    enum zmk_transport transport;
+};
+
+struct zmk_endpoint_instance zmk_endpoints_selected(void);
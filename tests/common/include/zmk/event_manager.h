@@ -0,0 +1,21 @@
+#pragma once
+
+// Minimal stand-in for the ZMK event manager, with events carrying a pointer to
+// their payload. Listeners are defined like in ZMK, so that tests can invoke
+// them through zmk_listener_<name>.callback; subscriptions are not dispatched.
+
+typedef struct {
+    void *data;
+} zmk_event_t;
+
+struct zmk_listener {
+    int (*callback)(const zmk_event_t *eh);
+};
+
+#define ZMK_LISTENER(mod, cb) const struct zmk_listener zmk_listener_##mod = {.callback = cb};
+#define ZMK_SUBSCRIPTION(mod, ev_type)
+
+#define ZMK_EVENT_DECLARE(event_type)                                                 \
+    static inline struct event_type *as_##event_type(const zmk_event_t *eh) {         \
+        return (struct event_type *)eh->data;                                         \
+    }
@@ -0,0 +1,10 @@
+#pragma once
+
+#include <stdint.h>
+#include <zmk/event_manager.h>
+
+struct zmk_battery_state_changed {
+    uint8_t state_of_charge;
+};
+
+ZMK_EVENT_DECLARE(zmk_battery_state_changed);
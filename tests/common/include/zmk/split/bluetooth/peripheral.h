@@ -0,0 +1,5 @@
+#pragma once
+
+#include <stdbool.h>
+
+bool zmk_split_bt_peripheral_is_connected(void);
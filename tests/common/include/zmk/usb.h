@@ -0,0 +1,13 @@
+#pragma once
+
+#include <stdbool.h>
+#include <zephyr/usb/usb_device.h>
+
+enum zmk_usb_conn_state {
+    ZMK_USB_CONN_NONE,
+    ZMK_USB_CONN_POWERED,
+    ZMK_USB_CONN_HID,
+};
+
+bool zmk_usb_is_powered(void);
+enum usb_dc_status_code zmk_usb_get_status(void);
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <zmk/endpoints.h>
+
+// inputs returned by the stubbed ZMK functions, set by the tests
+extern bool stub_usb_powered;
+extern uint8_t stub_battery_soc;
+extern bool stub_profile_open;
+extern enum zmk_transport stub_transport;
@@ -0,0 +1,37 @@
+#include <zephyr/logging/log.h>
+
+#include <zmk/battery.h>
+#include <zmk/ble.h>
+#include <zmk/endpoints.h>
+#include <zmk/split/bluetooth/peripheral.h>
+#include <zmk/usb.h>
+#include <zmk_stubs.h>
+
+LOG_MODULE_REGISTER(zmk, CONFIG_ZMK_LOG_LEVEL);
+
+bool stub_usb_powered;
+uint8_t stub_battery_soc = 100;
+bool stub_profile_open;
+enum zmk_transport stub_transport = ZMK_TRANSPORT_USB;
+
+bool zmk_usb_is_powered(void) { return stub_usb_powered; }
+
+enum usb_dc_status_code zmk_usb_get_status(void) {
+    return stub_usb_powered ? USB_DC_CONFIGURED : USB_DC_DISCONNECTED;
+}
+
+uint8_t zmk_battery_state_of_charge(void) { return stub_battery_soc; }
+
+struct zmk_endpoint_instance zmk_endpoints_selected(void) {
+    return (struct zmk_endpoint_instance){.transport = stub_transport};
+}
+
+int zmk_ble_active_profile_index(void) { return 0; }
+
+bool zmk_ble_active_profile_is_connected(void) { return false; }
+
+bool zmk_ble_active_profile_is_open(void) { return stub_profile_open; }
+
+int zmk_ble_put_peripheral_addr(const bt_addr_le_t *addr) { return -ENOMEM; }
+
+bool zmk_split_bt_peripheral_is_connected(void) { return false; }
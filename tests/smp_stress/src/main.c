@@ -0,0 +1,95 @@
+#include <zephyr/kernel.h>
+#include <zephyr/ztest.h>
+
+#include <zmk_stubs.h>
+
+// white-box test of the single-owner handoff between policy producers and the
+// processing thread
+#include "widget.c"
+
+#define PRODUCER_UPDATES 20000
+#define STACK_SIZE       1024
+
+// every producer owns one field of the input state, so the final state is known
+// regardless of how the updates interleave
+static struct producer {
+    uint16_t mask;
+    uint16_t final_value;
+    uint32_t updates;
+} producers[] = {
+    {POLICY_USB_MASK, 1},
+    {POLICY_TRANSPORT_MASK, 1},
+    {POLICY_BATTERY_MASK, POLICY_BATTERY_20},
+};
+
+static K_THREAD_STACK_ARRAY_DEFINE(producer_stacks, ARRAY_SIZE(producers), STACK_SIZE);
+static struct k_thread producer_threads[ARRAY_SIZE(producers)];
+
+static void producer_fn(void *p0, void *p1, void *p2) {
+    struct producer *p = p0;
+    uint16_t values = FIELD_GET(p->mask, p->mask) + 1;
+
+    for (uint32_t i = 0; i < PRODUCER_UPDATES; i++) {
+        uint16_t rearm = i % 7 == 0 ? BIT(PATTERN_CONNECTED) : 0;
+
+        policy_set(p->mask, FIELD_PREP(p->mask, i % values), rearm);
+        p->updates++;
+    }
+    policy_set(p->mask, FIELD_PREP(p->mask, p->final_value), 0);
+    p->updates++;
+}
+
+static void *smp_stress_setup(void) {
+    // let the init thread and the debounced connectivity work publish the
+    // initial state first
+    while (!atomic_get(&initialized)) {
+        k_sleep(K_MSEC(10));
+    }
+    k_sleep(K_MSEC(100));
+    return NULL;
+}
+
+ZTEST(smp_stress, test_producers_converge) {
+    unsigned int cpus = arch_num_cpus();
+    uint16_t expected = 0;
+
+    zassert_true(cpus > 1, "Test needs an SMP target");
+
+    int64_t start = k_uptime_get();
+    for (size_t i = 0; i < ARRAY_SIZE(producers); i++) {
+        k_thread_create(&producer_threads[i], producer_stacks[i], STACK_SIZE, producer_fn,
+                        &producers[i], NULL, NULL, K_PRIO_PREEMPT(1), 0, K_FOREVER);
+        zassert_ok(k_thread_cpu_pin(&producer_threads[i], i % cpus));
+        expected |= FIELD_PREP(producers[i].mask, producers[i].final_value);
+    }
+    for (size_t i = 0; i < ARRAY_SIZE(producers); i++) {
+        k_thread_start(&producer_threads[i]);
+    }
+
+    uint32_t updates = 0;
+    for (size_t i = 0; i < ARRAY_SIZE(producers); i++) {
+        zassert_ok(k_thread_join(&producer_threads[i], K_FOREVER));
+        updates += producers[i].updates;
+    }
+    int64_t elapsed_ms = MAX(k_uptime_get() - start, 1);
+
+    // no update of a field may be lost to a concurrent update of another one
+    zassert_equal(atomic_get(&policy_state), expected, "Policy state 0x%03lx, expected 0x%03x",
+                  (unsigned long)atomic_get(&policy_state), expected);
+
+    // the processing thread has to catch up with the final state on its own
+    int64_t deadline = k_uptime_get() + 10000;
+    while (policy_current != POLICY_TABLE[expected] || k_msgq_num_used_get(&led_msgq) > 0 ||
+           k_msgq_num_used_get(&led_prio_msgq) > 0) {
+        zassert_true(k_uptime_get() < deadline, "Processing thread did not converge");
+        k_sleep(K_MSEC(10));
+    }
+    zassert_equal(led_default_color, COLOR_ON, "USB background not applied");
+    zassert_true(led_current_patterns & BIT(PATTERN_BATT_20), "Battery pattern not applied");
+
+    TC_PRINT("%u policy updates from %zu producers on %u CPUs in %lld ms, %lld updates/s\n",
+             updates, ARRAY_SIZE(producers), cpus, (long long)elapsed_ms,
+             (long long)(updates * 1000LL / elapsed_ms));
+}
+
+ZTEST_SUITE(smp_stress, NULL, smp_stress_setup, NULL, NULL, NULL);
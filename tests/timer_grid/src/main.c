@@ -0,0 +1,104 @@
+#include <zephyr/kernel.h>
+#include <zephyr/ztest.h>
+
+#include <zmk_stubs.h>
+
+// white-box test of the timer grid, with the grid switchable between runs
+static int64_t test_grid_ms = CONFIG_LED_WIDGET_TIMER_GRID_MS;
+#undef CONFIG_LED_WIDGET_TIMER_GRID_MS
+#define CONFIG_LED_WIDGET_TIMER_GRID_MS test_grid_ms
+#include "widget.c"
+
+// length of a measurement, so that the wake-up count is per minute
+#define RUN_MS 60000
+
+// connectivity events come in pairs, like a disconnect followed by a reconnect,
+// at a period that drifts against the grid
+#define BURST_OFFSET_MS 537
+#define BURST_PERIOD_MS 1930
+#define BURST_GAP_MS    20
+
+// wake-ups of the CPU from idle, counted through the user tracing hooks
+static volatile bool counting;
+static volatile bool was_idle;
+static volatile uint32_t wakeups;
+
+void sys_trace_idle_user(void) { was_idle = true; }
+
+void sys_trace_thread_switched_in_user(void) {
+    if (was_idle) {
+        was_idle = false;
+        if (counting) {
+            wakeups++;
+        }
+    }
+}
+
+static void set_battery(uint8_t state_of_charge) {
+    struct zmk_battery_state_changed battery = {.state_of_charge = state_of_charge};
+    zmk_event_t ev = {.data = &battery};
+
+    led_battery_listener_cb(&ev);
+}
+
+static void connectivity_event(void) {
+    zmk_event_t ev = {.data = NULL};
+
+    led_output_listener_cb(&ev);
+}
+
+// run advertising with a battery reminder behind it, then the battery reminder
+// alone, with connectivity events throughout, and count the wake-ups
+static uint32_t count_wakeups(int64_t grid_ms) {
+    test_grid_ms = grid_ms;
+
+    // start both runs at the same phase of the grid
+    int64_t start = ROUND_UP(k_uptime_get() + 1000, 1000);
+    k_sleep(K_TIMEOUT_ABS_MS(start));
+
+    wakeups = 0;
+    counting = true;
+    stub_profile_open = true;
+    set_battery(25);
+    connectivity_event();
+
+    for (int64_t at = BURST_OFFSET_MS; at < RUN_MS; at += BURST_PERIOD_MS) {
+        if (at >= RUN_MS / 2) {
+            stub_profile_open = false;
+        }
+        k_sleep(K_TIMEOUT_ABS_MS(start + at));
+        connectivity_event();
+        k_sleep(K_TIMEOUT_ABS_MS(start + at + BURST_GAP_MS));
+        connectivity_event();
+    }
+    k_sleep(K_TIMEOUT_ABS_MS(start + RUN_MS));
+    counting = false;
+
+    // let the widget go idle before the next run
+    set_battery(100);
+    connectivity_event();
+    k_sleep(K_MSEC(5000));
+    zassert_equal(led_current_patterns, 0, "Widget not idle after run");
+
+    return wakeups;
+}
+
+static void *timer_grid_setup(void) {
+    while (!atomic_get(&initialized)) {
+        k_sleep(K_MSEC(10));
+    }
+    k_sleep(K_MSEC(1000));
+    return NULL;
+}
+
+ZTEST(timer_grid, test_fewer_wakeups) {
+    uint32_t unaligned = count_wakeups(0);
+    uint32_t aligned = count_wakeups(100);
+
+    TC_PRINT("Wake-ups per minute: %u without grid, %u with 100 ms grid\n", unaligned,
+             aligned);
+    zassert_true(aligned < unaligned, "Grid did not merge wake-ups: %u with, %u without",
+                 aligned, unaligned);
+}
+
+ZTEST_SUITE(timer_grid, NULL, timer_grid_setup, NULL, NULL, NULL);